@@ -36,6 +36,8 @@ Library. If not, see https://www.gnu.org/licenses/agpl.txt.
 #include <utility> // std::pair
 #include <functional> // std::function, std::bind
 #include <expected>
+#include <mutex>
+#include <vector>
 
 namespace mg7x {
 
@@ -68,7 +70,7 @@ private:
 
 	int m_epollfd;
 
-	std::expected<int,int> epoll_upd(int fd, int events, int action, Awaiter * awaiter = nullptr);
+	std::expected<int,int> epoll_upd(int fd, int events, int action, EpollFunc * callback = nullptr);
 
 public:
 	explicit EpollCtl(int epoll_fd);
@@ -77,10 +79,55 @@ public:
 
 	std::expected<int,int> add_interest(int fd, int events, Awaiter & awaiter);
 
+	// For long-lived listeners (e.g. a connection multiplexing many coroutines) which handle
+	// their events directly rather than resuming a single awaiting coroutine
+	std::expected<int,int> mod_interest(int fd, int events, EpollFunc & callback);
+
+	std::expected<int,int> add_interest(int fd, int events, EpollFunc & callback);
+
 	std::expected<int,int> clr_interest(int fd);
 
 };
 
+// Coroutines posted from other threads (a ThreadPool's workers, say) to be resumed by the thread
+// dispatching epoll events, as it's woken by an eventfd; the first post to an empty inbox signals
+// it, and those that follow are taken with it
+class EpollInbox
+{
+	EpollFunc m_callback = std::bind(&EpollInbox::onEvent, this, std::placeholders::_1);
+	int m_fd{-1};
+	std::mutex m_mtx;
+	std::vector<std::coroutine_handle<>> m_posted;
+	std::vector<std::coroutine_handle<>> m_resuming;
+
+	void onEvent(int events);
+
+public:
+	EpollInbox() = default;
+	~EpollInbox();
+	EpollInbox(const EpollInbox &) = delete;
+	EpollInbox & operator=(const EpollInbox &) = delete;
+
+	// Creates the eventfd, and adds it to the interest-list of `ctl`
+	std::expected<int,int> init(EpollCtl & ctl);
+
+	// Callable from any thread
+	void post(std::coroutine_handle<> h) noexcept;
+};
+
+struct EpollResumeOn
+{
+	EpollInbox & m_inbox;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) const noexcept { m_inbox.post(h); }
+	void await_resume() const noexcept {}
+};
+
+// `co_await resume_on(inbox)` returns the coroutine to the epoll thread, as from a ThreadPool
+// worker it was moved to by `co_await schedule_on(pool)`
+inline EpollResumeOn resume_on(EpollInbox & inbox) noexcept { return EpollResumeOn{inbox}; }
+
 };
 
 #endif // __mg_coro_epoll__H__
@@ -0,0 +1,166 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+#ifndef mg_coro_kdb_client__H__
+#define mg_coro_kdb_client__H__
+
+#include <stdint.h>
+
+#include <coroutine>
+#include <deque>
+#include <expected>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "MgKdbType.H"
+
+#include "mg_io.h"
+#include "mg_coro_domain_obj.h"
+#include "mg_coro_epoll.h"
+#include "mg_coro_task.h"
+
+namespace mg7x {
+
+using KdbQueryResult = std::expected<ReadMsgResult,ErrnoMsg>;
+
+/*
+	A client which pipelines sync requests over a single kdb+ connection.
+
+	Any number of coroutines may `co_await client.query(..)` at once: each request is written
+	as soon as the socket accepts it, without waiting for the responses to those before it.
+	kdb+ answers the sync requests on a handle in the order it receives them, so responses are
+	matched to requests first-in first-out; async messages from the server are discarded.
+	Throughput is then governed by the pipeline depth rather than the round-trip time.
+
+	The client registers its own callback with the `EpollCtl`, and resumes the awaiting
+	coroutines from within the event loop. It must outlive them, and it isn't movable.
+	Should the connection fail, every outstanding (and any later) query returns the error, though
+	responses the server sent before hanging up are still delivered; as writes use `write(2)`,
+	the application should ignore `SIGPIPE` to see a peer's hang-up as such.
+*/
+class KdbClient
+{
+public:
+	struct Awaiter
+	{
+		KdbClient & m_client;
+		std::coroutine_handle<> m_handle;
+		KdbQueryResult m_result;
+		bool m_queued{false};
+
+		explicit Awaiter(KdbClient & client) : m_client(client) {}
+		~Awaiter();
+
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<> h) noexcept;
+
+		KdbQueryResult await_resume() noexcept { return std::move(m_result); }
+	};
+
+	constexpr static size_t READ_BUF_SZ = 64 * 1024;
+
+private:
+	EpollCtl & m_epoll;
+	io::TcpConn m_conn;
+	EpollFunc m_callback;
+	int m_events{0};
+	bool m_failed{false};
+	ErrnoMsg m_error{};
+
+	std::vector<int8_t> m_out{};
+	size_t m_out_off{0};
+
+	std::vector<int8_t> m_inb;
+	size_t m_inb_beg{0};
+	size_t m_inb_end{0};
+	KdbIpcMessageReader m_rdr{};
+	ReadMsgResult m_res{};
+
+	std::deque<Awaiter*> m_pending{};
+	uint64_t m_num_sent{0};
+	uint64_t m_num_recv{0};
+
+	void onEvent(int events);
+	bool flush();
+	bool drain();
+	void fail(ErrnoMsg err);
+	bool want(int events);
+
+public:
+	/**
+		@param epoll the event-loop in which the connection's events are handled
+		@param conn a connection which has completed the kdb+ handshake (_C.f._ `kdb_connect`),
+		            and is owned, and eventually closed, by the client
+	 */
+	KdbClient(EpollCtl & epoll, io::TcpConn conn);
+	~KdbClient();
+
+	KdbClient(const KdbClient &) = delete;
+	KdbClient & operator=(const KdbClient &) = delete;
+
+	/**
+		Registers the connection with the event-loop; required before the first query.
+	 */
+	std::expected<int,ErrnoMsg> open();
+
+	/**
+		Sends `qry` as a sync request and completes with its response. The request is serialised
+		when the returned task is first awaited, so `qry` need only live until then.
+	 */
+	TASK_TYPE<KdbQueryResult> query(const KdbBase & qry);
+
+	const io::TcpConn & conn() const noexcept { return m_conn; }
+	size_t outstanding() const noexcept { return m_pending.size(); }
+	bool failed() const noexcept { return m_failed; }
+	const ErrnoMsg & error() const noexcept { return m_error; }
+	uint64_t numSent() const noexcept { return m_num_sent; }
+	uint64_t numReceived() const noexcept { return m_num_recv; }
+};
+
+/*
+	Spreads queries across connections to replicated processes (e.g. a set of HDBs or RDBs
+	serving the same data): each query goes to the healthy connection with the fewest
+	outstanding requests, ties going round-robin.
+*/
+class KdbClientPool
+{
+	std::vector<std::unique_ptr<KdbClient>> m_clients{};
+	size_t m_next{0};
+
+public:
+	void add(std::unique_ptr<KdbClient> client) { m_clients.push_back(std::move(client)); }
+
+	size_t size() const noexcept { return m_clients.size(); }
+
+	KdbClient & at(size_t idx) { return *m_clients.at(idx); }
+
+	/**
+		@return the connection the next query would be sent on, or `nullptr` if none is healthy
+	 */
+	KdbClient * pick() noexcept;
+
+	TASK_TYPE<KdbQueryResult> query(const KdbBase & qry);
+};
+
+/**
+	Connects to `host:service`, completes the kdb+ handshake and opens a `KdbClient` upon it.
+ */
+TASK_TYPE<std::expected<std::unique_ptr<KdbClient>,ErrnoMsg>>
+	kdb_client_connect(EpollCtl & epoll, std::string_view host, std::string_view service, std::string_view user);
+
+} // end namespace mg7x
+
+#endif
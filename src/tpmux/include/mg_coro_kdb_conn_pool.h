@@ -0,0 +1,181 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+#ifndef mg_coro_kdb_conn_pool__H__
+#define mg_coro_kdb_conn_pool__H__
+
+#include <stdint.h>
+
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <expected>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mg_io.h"
+#include "mg_coro_domain_obj.h"
+#include "mg_coro_epoll.h"
+#include "mg_coro_task.h"
+#include "mg_coro_tcp_connect.h"
+
+namespace mg7x {
+
+/*
+	Keeps connections to kdb+ processes open, and logged in, between uses, so that a short-lived
+	query pays neither the TCP connect (nor the lookup before it) nor the handshake.
+
+	Connections are pooled per target, being `host:service` and the user logged in as. At most
+	`m_max_per_target` are open to a target at once, whether lent out or idle: `acquire` beyond
+	that waits for one to be released. An idle connection is checked before being lent out (the
+	server must not have hung up, nor sent anything unbidden); those idle for longer than
+	`m_max_idle` are closed by `prune`, and `warm` opens connections ahead of their use.
+
+	Everything happens on the event-loop's thread; leases must not outlive the pool.
+*/
+class KdbConnPool
+{
+	struct Target;
+
+public:
+	struct Limits
+	{
+		size_t m_max_per_target{4};
+		size_t m_min_idle{1};
+		std::chrono::steady_clock::duration m_max_idle{std::chrono::minutes{5}};
+	};
+
+	/**
+		A connection lent by the pool, returned on destruction (or `release`) to be reused; unless
+		`discard` was called, as should be after an I/O error, or with a response left unread.
+	 */
+	class Lease
+	{
+		KdbConnPool *m_pool{nullptr};
+		Target *m_target{nullptr};
+		io::TcpConn m_conn{};
+		bool m_discard{false};
+
+	public:
+		Lease() = default;
+		Lease(KdbConnPool & pool, Target & target, io::TcpConn conn)
+		 : m_pool(&pool)
+		 , m_target(&target)
+		 , m_conn(conn)
+		{}
+		Lease(Lease && rhs) noexcept;
+		Lease & operator=(Lease && rhs) noexcept;
+		~Lease() { release(); }
+
+		Lease(const Lease &) = delete;
+		Lease & operator=(const Lease &) = delete;
+
+		const io::TcpConn & conn() const noexcept { return m_conn; }
+
+		void discard() noexcept { m_discard = true; }
+
+		void release() noexcept;
+	};
+
+private:
+	struct Idle
+	{
+		io::TcpConn m_conn;
+		std::chrono::steady_clock::time_point m_since;
+	};
+
+	// awaits a connection released to its target, or room to open one
+	struct Waiter
+	{
+		Target & m_target;
+		std::coroutine_handle<> m_handle{};
+		io::TcpConn m_conn{};
+		bool m_queued{false};
+
+		explicit Waiter(Target & target) : m_target(target) {}
+		~Waiter();
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> h) noexcept;
+		void await_resume() const noexcept {}
+	};
+
+	struct Target
+	{
+		std::string m_host;
+		std::string m_service;
+		std::string m_user;
+		std::vector<Idle> m_idle{};
+		size_t m_num_open{0};
+		std::deque<Waiter*> m_waiters{};
+	};
+
+	EpollCtl & m_epoll;
+	AddrCache & m_cache;
+	Limits m_limits;
+	bool m_closed{false};
+	// the connections refer to the strings of their target, which mustn't move
+	std::vector<std::unique_ptr<Target>> m_targets{};
+
+	uint64_t m_num_opened{0};
+	uint64_t m_num_reused{0};
+	uint64_t m_num_discarded{0};
+	uint64_t m_num_waits{0};
+
+	Target & target(std::string_view host, std::string_view service, std::string_view user);
+	TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> open(Target & tgt);
+	void put(Target & tgt, io::TcpConn conn, bool discard);
+	void close(Target & tgt, io::TcpConn conn);
+	void wake(Target & tgt, io::TcpConn conn);
+
+public:
+	KdbConnPool(EpollCtl & epoll, AddrCache & cache, Limits limits);
+	KdbConnPool(EpollCtl & epoll, AddrCache & cache) : KdbConnPool(epoll, cache, Limits{}) {}
+	~KdbConnPool();
+
+	KdbConnPool(const KdbConnPool &) = delete;
+	KdbConnPool & operator=(const KdbConnPool &) = delete;
+
+	/**
+		Lends a logged-in connection to `host:service`: an idle one if any is healthy, else a new
+		one if the target's limit allows, else the next to be released.
+	 */
+	TASK_TYPE<std::expected<Lease,ErrnoMsg>> acquire(std::string_view host, std::string_view service, std::string_view user);
+
+	/**
+		Opens connections to `host:service` until `m_min_idle` are idle, within the target's limit.
+		@return the number opened
+	 */
+	TASK_TYPE<std::expected<size_t,ErrnoMsg>> warm(std::string_view host, std::string_view service, std::string_view user);
+
+	/**
+		Closes the idle connections which have been so for longer than `m_max_idle`, or which
+		fail the health check.
+		@return the number closed
+	 */
+	size_t prune();
+
+	size_t numIdle() const noexcept;
+	size_t numOpen() const noexcept;
+	uint64_t numOpened() const noexcept { return m_num_opened; }
+	uint64_t numReused() const noexcept { return m_num_reused; }
+	uint64_t numDiscarded() const noexcept { return m_num_discarded; }
+	uint64_t numWaits() const noexcept { return m_num_waits; }
+};
+
+} // end namespace mg7x
+
+#endif
@@ -23,6 +23,7 @@
 #include <stdexcept> // std::logic_error
 
 #include "mg_fmt_defs.h"
+#include "MgCoroFrame.H"
 
 
 namespace mg7x {
@@ -85,7 +86,8 @@ public:
 		UNSET, EXCEPTION, RESULT
 	};
 
-	struct Promise
+	// frames are recycled by the creating thread's pool, rather than each being newed
+	struct Promise : PooledFrame
 	{
 		struct FinalAwaiter {
 
@@ -267,7 +269,7 @@ namespace mg7x {
 template<typename T>
 struct TopLevelTask
 {
-	struct Policy
+	struct Policy : PooledFrame
 	{
 		TopLevelTask get_return_object() noexcept {
 			auto hdl = std::coroutine_handle<Policy>::from_promise(*this);
@@ -279,7 +281,9 @@ struct TopLevelTask
 			TRA_PRINT(CYN "TopLevelTask" RST "::" YEL "Policy" RST "::initial_suspend: m_handle.address {}", hdl.address());
 			return {};
 		}
-		SuspendNever final_suspend() noexcept {
+		// Suspending here keeps the frame (and `p_result`) alive until the `TopLevelTask` is
+		// destroyed, so `done` and `value` remain valid once the coroutine has finished
+		SuspendAlways final_suspend() noexcept {
 			auto hdl = std::coroutine_handle<Policy>::from_promise(*this);
 			TRA_PRINT(CYN "TopLevelTask" RST "::" YEL "Policy" RST "::" RED "final_suspend" RST ": m_handle.address {}", hdl.address());
 			return {};
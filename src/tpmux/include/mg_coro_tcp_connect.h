@@ -0,0 +1,99 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+#ifndef mg_coro_tcp_connect__H__
+#define mg_coro_tcp_connect__H__
+
+#include <stdint.h>
+#include <sys/socket.h> // struct sockaddr_storage, socklen_t
+
+#include <chrono>
+#include <expected>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mg_io.h"
+#include "mg_coro_domain_obj.h"
+#include "mg_coro_epoll.h"
+#include "mg_coro_task.h"
+
+namespace mg7x {
+
+/**
+	One result of a `getaddrinfo` lookup, copied so as to outlive it.
+ */
+struct ResolvedAddr
+{
+	int m_family;
+	int m_socktype;
+	int m_protocol;
+	socklen_t m_addrlen;
+	struct sockaddr_storage m_addr;
+};
+
+/*
+	Remembers the addresses `host:service` resolved to, for `ttl`, so that repeated connections
+	to the same process skip the (asynchronous, but thread-spawning) `getaddrinfo_a`.
+	Entries are dropped early by `evict`, which `tcp_connect` calls should none of the cached
+	addresses accept a connection.
+*/
+class AddrCache
+{
+	struct Entry
+	{
+		std::vector<ResolvedAddr> m_addrs;
+		std::chrono::steady_clock::time_point m_expiry;
+	};
+
+	std::unordered_map<std::string,Entry> m_entries{};
+	std::chrono::steady_clock::duration m_ttl;
+	uint64_t m_num_hits{0};
+	uint64_t m_num_misses{0};
+
+	static std::string key(std::string_view host, std::string_view service);
+
+public:
+	explicit AddrCache(std::chrono::steady_clock::duration ttl = std::chrono::seconds{60})
+	 : m_ttl(ttl)
+	{}
+
+	/**
+		@param addrs receives a copy of the cached addresses, if any have yet to expire
+		@return `true` if `addrs` was filled in
+	 */
+	bool find(std::string_view host, std::string_view service, std::vector<ResolvedAddr> & addrs);
+
+	void store(std::string_view host, std::string_view service, const std::vector<ResolvedAddr> & addrs);
+
+	void evict(std::string_view host, std::string_view service);
+
+	size_t size() const noexcept { return m_entries.size(); }
+	uint64_t numHits() const noexcept { return m_num_hits; }
+	uint64_t numMisses() const noexcept { return m_num_misses; }
+};
+
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>>
+	tcp_connect(EpollCtl & epoll, std::string_view host, std::string_view service);
+
+/**
+	As `tcp_connect(epoll, host, service)`, but resolving `host:service` through `cache`.
+ */
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>>
+	tcp_connect(EpollCtl & epoll, AddrCache & cache, std::string_view host, std::string_view service);
+
+} // end namespace mg7x
+
+#endif
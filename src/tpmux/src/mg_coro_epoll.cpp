@@ -14,8 +14,10 @@
  */
 
 #include <sys/epoll.h>	// struct epoll_event
+#include <sys/eventfd.h>	// EFD_NONBLOCK
 #include <coroutine>
 #include <string.h>
+#include <tuple> // std::ignore
 
 #include "MgIoDefs.H"
 #include "mg_fmt_defs.h"
@@ -55,11 +57,11 @@ void EpollCtl::Awaiter::onEvent(int events) {
 	}
 }
 
-std::expected<int,int> EpollCtl::epoll_upd(int fd, int events, int action, Awaiter * awaiter) {
+std::expected<int,int> EpollCtl::epoll_upd(int fd, int events, int action, EpollFunc * callback) {
 	struct epoll_event ev;
 	ev.events = events;
-	if (nullptr != awaiter) {
-		ev.data.ptr = &awaiter->m_callback;
+	if (nullptr != callback) {
+		ev.data.ptr = callback;
 	}
 	auto ret = ::mg7x::io::epoll_ctl(m_epollfd, action, fd, &ev);
 	if (ret.has_value()) {
@@ -75,12 +77,22 @@ EpollCtl::EpollCtl(int epoll_fd)
 
 std::expected<int,int> EpollCtl::mod_interest(int fd, int events, Awaiter & awaiter) {
 	TRA_PRINT("EpollCtl::mod_interest, fd = {}, events = {}", fd, events);
-	return epoll_upd(fd, events, EPOLL_CTL_MOD, &awaiter);
+	return epoll_upd(fd, events, EPOLL_CTL_MOD, &awaiter.m_callback);
 }
 
 std::expected<int,int> EpollCtl::add_interest(int fd, int events, Awaiter & awaiter) {
 	TRA_PRINT("EpollCtl::add_interest, fd = {}, events = {}", fd, events);
-	return epoll_upd(fd, events, EPOLL_CTL_ADD, &awaiter);
+	return epoll_upd(fd, events, EPOLL_CTL_ADD, &awaiter.m_callback);
+}
+
+std::expected<int,int> EpollCtl::mod_interest(int fd, int events, EpollFunc & callback) {
+	TRA_PRINT("EpollCtl::mod_interest, fd = {}, events = {}", fd, events);
+	return epoll_upd(fd, events, EPOLL_CTL_MOD, &callback);
+}
+
+std::expected<int,int> EpollCtl::add_interest(int fd, int events, EpollFunc & callback) {
+	TRA_PRINT("EpollCtl::add_interest, fd = {}, events = {}", fd, events);
+	return epoll_upd(fd, events, EPOLL_CTL_ADD, &callback);
 }
 
 std::expected<int,int> EpollCtl::clr_interest(int fd) {
@@ -88,4 +100,52 @@ std::expected<int,int> EpollCtl::clr_interest(int fd) {
 	return epoll_upd(fd, 0, EPOLL_CTL_DEL);
 }
 
+EpollInbox::~EpollInbox() {
+	if (m_fd >= 0) {
+		std::ignore = ::mg7x::io::close(m_fd);
+	}
+}
+
+std::expected<int,int> EpollInbox::init(EpollCtl & ctl) {
+	auto ret = ::mg7x::io::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!ret.has_value()) {
+		ERR_PRINT("EpollInbox::init in eventfd: {}", strerror(ret.error()));
+		return ret;
+	}
+	m_fd = ret.value();
+	TRA_PRINT("EpollInbox::init, fd = {}", m_fd);
+	return ctl.add_interest(m_fd, EPOLLIN, m_callback);
+}
+
+void EpollInbox::post(std::coroutine_handle<> h) noexcept {
+	bool first;
+	{
+		std::lock_guard<std::mutex> lock{m_mtx};
+		m_posted.push_back(h);
+		first = 1 == m_posted.size();
+	}
+	if (first) {
+		const uint64_t one = 1;
+		auto ret = ::mg7x::io::write(m_fd, &one, sizeof one);
+		if (!ret.has_value()) {
+			ERR_PRINT("EpollInbox::post in write: {}", strerror(ret.error()));
+		}
+	}
+}
+
+void EpollInbox::onEvent(int events) {
+	uint64_t val;
+	// resets the eventfd, ahead of taking what was posted, so that a post that follows signals it again
+	std::ignore = ::mg7x::io::read(m_fd, &val, sizeof val);
+	{
+		std::lock_guard<std::mutex> lock{m_mtx};
+		m_resuming.swap(m_posted);
+	}
+	TRA_PRINT("EpollInbox::onEvent: events {}, resuming {}", events, m_resuming.size());
+	for (std::coroutine_handle<> h : m_resuming) {
+		h.resume();
+	}
+	m_resuming.clear();
+}
+
 };
@@ -0,0 +1,297 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm> // std::copy, std::replace
+#include <expected>
+#include <functional> // std::bind
+
+#include "MgIoDefs.H"
+#include "MgKdbType.H"
+
+#include "mg_coro_kdb_client.h"
+#include "mg_fmt_defs.h"
+
+namespace mg7x {
+
+extern
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>>
+	tcp_connect(EpollCtl & epoll, std::string_view host, std::string_view service);
+
+extern
+TASK_TYPE<std::expected<KdbIpcLevel,ErrnoMsg>>
+	kdb_connect(EpollCtl & epoll, const io::TcpConn & conn, std::string_view user);
+
+//-------------------------------------------------------------------------------- KdbClient::Awaiter
+void KdbClient::Awaiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+	// the request's bytes are already queued, so its response is the next one unclaimed
+	m_handle = h;
+	m_queued = true;
+	m_client.m_pending.push_back(this);
+}
+
+KdbClient::Awaiter::~Awaiter()
+{
+	// A coroutine destroyed while its query is outstanding leaves a gap in the queue, so that
+	// its response is still matched (and discarded) in turn
+	if (m_queued)
+		std::replace(m_client.m_pending.begin(), m_client.m_pending.end(), this, static_cast<Awaiter*>(nullptr));
+}
+
+//-------------------------------------------------------------------------------- KdbClient
+KdbClient::KdbClient(EpollCtl & epoll, io::TcpConn conn)
+ : m_epoll(epoll)
+ , m_conn(conn)
+ , m_callback(std::bind(&KdbClient::onEvent, this, std::placeholders::_1))
+ , m_inb(READ_BUF_SZ)
+{
+}
+
+KdbClient::~KdbClient()
+{
+	fail(ErrnoMsg{0, "Client closed"});
+	if (-1 != m_conn.sock_fd())
+		std::ignore = ::mg7x::io::close(m_conn.sock_fd());
+}
+
+std::expected<int,ErrnoMsg> KdbClient::open()
+{
+	std::expected<int,int> result = m_epoll.add_interest(m_conn.sock_fd(), EPOLLIN, m_callback);
+	if (!result.has_value()) {
+		ERR_PRINT(YEL "KdbClient" RST "::open: failed in EpollCtl::add_interest: {}", strerror(result.error()));
+		return std::unexpected(ErrnoMsg{result.error(), "Failed in EpollCtl::add_interest"});
+	}
+	m_events = EPOLLIN;
+	DBG_PRINT(YEL "KdbClient" RST "::open: listening on {}", m_conn);
+	return result.value();
+}
+
+bool KdbClient::want(int events)
+{
+	if (events == m_events)
+		return true;
+	std::expected<int,int> result = m_epoll.mod_interest(m_conn.sock_fd(), events, m_callback);
+	if (!result.has_value()) {
+		fail(ErrnoMsg{result.error(), "Failed in EpollCtl::mod_interest"});
+		return false;
+	}
+	m_events = events;
+	return true;
+}
+
+TASK_TYPE<KdbQueryResult> KdbClient::query(const KdbBase & qry)
+{
+	if (m_failed)
+		co_return std::unexpected(m_error);
+	if (0 == m_events)
+		co_return std::unexpected(ErrnoMsg{0, "Client not open"});
+
+	KdbIpcMessageWriter writer{KdbMsgType::SYNC, qry};
+	const size_t off = m_out.size();
+	m_out.resize(off + writer.ipcLength());
+	if (WriteResult::WR_OK != writer.write(m_out.data() + off, writer.ipcLength())) {
+		m_out.resize(off);
+		co_return std::unexpected(ErrnoMsg{0, "Failed to serialise query"});
+	}
+	m_num_sent += 1;
+
+	if (!flush())
+		co_return std::unexpected(m_error);
+
+	Awaiter awaiter{*this};
+	co_return co_await awaiter;
+}
+
+bool KdbClient::flush()
+{
+	while (m_out_off < m_out.size()) {
+		std::expected<ssize_t,int> io_res = ::mg7x::io::write(m_conn.sock_fd(), m_out.data() + m_out_off, m_out.size() - m_out_off);
+		if (!io_res.has_value()) {
+			const int err_num = io_res.error();
+			if (EAGAIN == err_num || EWOULDBLOCK == err_num)
+				return want(EPOLLIN|EPOLLOUT);
+			if (EINTR == err_num)
+				continue;
+			ERR_PRINT(YEL "KdbClient" RST "::flush: failed in write: {}", strerror(err_num));
+			// No more requests can be sent, but the server may yet have answered those before:
+			// the outstanding queries are failed only once reading fails too
+			m_failed = true;
+			m_error = ErrnoMsg{err_num, "Failed while writing query"};
+			m_out.clear();
+			m_out_off = 0;
+			return false;
+		}
+		m_out_off += io_res.value();
+	}
+	m_out.clear();
+	m_out_off = 0;
+	return want(EPOLLIN);
+}
+
+bool KdbClient::drain()
+{
+	while (true) {
+		std::expected<ssize_t,int> io_res = ::mg7x::io::read(m_conn.sock_fd(), m_inb.data() + m_inb_end, m_inb.size() - m_inb_end);
+		if (!io_res.has_value()) {
+			const int err_num = io_res.error();
+			if (EAGAIN == err_num || EWOULDBLOCK == err_num)
+				return true;
+			if (EINTR == err_num)
+				continue;
+			ERR_PRINT(YEL "KdbClient" RST "::drain: failed in read: {}", strerror(err_num));
+			fail(ErrnoMsg{err_num, "Failed while reading response"});
+			return false;
+		}
+		if (0 == io_res.value()) {
+			WRN_PRINT(YEL "KdbClient" RST "::drain: connection {} closed by peer", m_conn);
+			fail(ErrnoMsg{0, "Connection closed by peer"});
+			return false;
+		}
+		m_inb_end += io_res.value();
+
+		while (m_inb_beg < m_inb_end) {
+			const uint64_t used = m_rdr.getInputBytesConsumed();
+			const bool complete = m_rdr.readMsg(m_inb.data() + m_inb_beg, m_inb_end - m_inb_beg, m_res);
+			m_inb_beg += m_rdr.getInputBytesConsumed() - used;
+			if (!complete) {
+				if (ReadResult::RD_INCOMPLETE != m_res.result) {
+					ERR_PRINT(YEL "KdbClient" RST "::drain: failed to decode response: {}", static_cast<int>(m_res.result));
+					fail(ErrnoMsg{0, "Failed to decode response"});
+					return false;
+				}
+				break;
+			}
+
+			ReadMsgResult res = std::move(m_res);
+			m_res = ReadMsgResult{};
+			m_rdr.reset();
+			if (KdbMsgType::RESPONSE != res.msg_typ) {
+				DBG_PRINT(YEL "KdbClient" RST "::drain: discarding message of type {} from {}", static_cast<int>(res.msg_typ), m_conn);
+				continue;
+			}
+			if (m_pending.empty()) {
+				WRN_PRINT(YEL "KdbClient" RST "::drain: discarding unsolicited response from {}", m_conn);
+				continue;
+			}
+
+			m_num_recv += 1;
+			Awaiter *awaiter = m_pending.front();
+			m_pending.pop_front();
+			if (nullptr == awaiter)
+				continue;
+			awaiter->m_queued = false;
+			awaiter->m_result = std::move(res);
+			// may issue further queries, or fail the connection; either way the buffer is ours
+			awaiter->m_handle.resume();
+			if (0 == m_events)
+				return false;
+		}
+
+		// retain the unconsumed bytes of a partial message
+		std::copy(m_inb.data() + m_inb_beg, m_inb.data() + m_inb_end, m_inb.data());
+		m_inb_end -= m_inb_beg;
+		m_inb_beg = 0;
+	}
+}
+
+void KdbClient::onEvent(int events)
+{
+	TRA_PRINT(YEL "KdbClient" RST "::onEvent: fd {}, events {}", m_conn.sock_fd(), events);
+	if (0 != (events & EPOLLIN) && !drain())
+		return;
+	if (0 != (events & (EPOLLERR|EPOLLHUP))) {
+		fail(ErrnoMsg{0, "EPOLLERR or EPOLLHUP reported for connection"});
+		return;
+	}
+	if (0 != (events & EPOLLOUT))
+		std::ignore = flush();
+}
+
+void KdbClient::fail(ErrnoMsg err)
+{
+	if (!m_failed) {
+		m_failed = true;
+		m_error = err;
+	}
+	if (0 != m_events) {
+		std::ignore = m_epoll.clr_interest(m_conn.sock_fd());
+		m_events = 0;
+	}
+
+	// resuming one may destroy another, which then takes itself off the queue
+	while (!m_pending.empty()) {
+		Awaiter *awaiter = m_pending.front();
+		m_pending.pop_front();
+		if (nullptr == awaiter)
+			continue;
+		awaiter->m_queued = false;
+		awaiter->m_result = std::unexpected(m_error);
+		awaiter->m_handle.resume();
+	}
+}
+
+//-------------------------------------------------------------------------------- KdbClientPool
+KdbClient * KdbClientPool::pick() noexcept
+{
+	KdbClient *best = nullptr;
+	const size_t num = m_clients.size();
+	for (size_t i = 0 ; i < num ; i++) {
+		KdbClient *cand = m_clients[(m_next + i) % num].get();
+		if (!cand->failed() && (nullptr == best || cand->outstanding() < best->outstanding()))
+			best = cand;
+	}
+	if (num > 0)
+		m_next = (m_next + 1) % num;
+	return best;
+}
+
+TASK_TYPE<KdbQueryResult> KdbClientPool::query(const KdbBase & qry)
+{
+	KdbClient *client = pick();
+	if (nullptr == client)
+		co_return std::unexpected(ErrnoMsg{0, "No healthy connection in pool"});
+	co_return co_await client->query(qry);
+}
+
+//-------------------------------------------------------------------------------- kdb_client_connect
+TASK_TYPE<std::expected<std::unique_ptr<KdbClient>,ErrnoMsg>>
+	kdb_client_connect(EpollCtl & epoll, std::string_view host, std::string_view service, std::string_view user)
+{
+	auto res_tc = co_await tcp_connect(epoll, host, service);
+	if (!res_tc.has_value()) {
+		ERR_PRINT(YEL "kdb_client_connect" RST ": failed to connect to {}:{}", host, service);
+		co_return std::unexpected(res_tc.error());
+	}
+
+	auto res_kc = co_await kdb_connect(epoll, res_tc.value(), user);
+	if (!res_kc.has_value()) {
+		ERR_PRINT(YEL "kdb_client_connect" RST ": failed during handshake with {}:{}", host, service);
+		std::ignore = ::mg7x::io::close(res_tc.value().sock_fd());
+		co_return std::unexpected(res_kc.error());
+	}
+
+	auto client = std::make_unique<KdbClient>(epoll, res_tc.value());
+	auto res_op = client->open();
+	if (!res_op.has_value())
+		co_return std::unexpected(res_op.error());
+
+	co_return std::move(client);
+}
+
+}; // end namespace mg7x
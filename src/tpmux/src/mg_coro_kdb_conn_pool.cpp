@@ -0,0 +1,283 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+
+#include <sys/socket.h> // MSG_PEEK, MSG_DONTWAIT
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm> // std::find
+#include <expected>
+#include <utility> // std::exchange
+
+#include "MgIoDefs.H"
+
+#include "mg_coro_kdb_conn_pool.h"
+#include "mg_fmt_defs.h"
+
+namespace mg7x {
+
+extern
+TASK_TYPE<std::expected<KdbIpcLevel,ErrnoMsg>>
+	kdb_connect(EpollCtl & epoll, const io::TcpConn & conn, std::string_view user);
+
+/**
+	An idle connection should have nothing to read: end-of-file means the server has hung up,
+	and any bytes at all leave the connection's state unknown.
+ */
+static bool idle_conn_healthy(const io::TcpConn & conn)
+{
+	int8_t byte;
+	std::expected<ssize_t,int> io_res = ::mg7x::io::recv(conn.sock_fd(), &byte, 1, MSG_PEEK|MSG_DONTWAIT);
+	if (io_res.has_value()) {
+		DBG_PRINT(YEL "KdbConnPool" RST ": idle {} is {}", conn, 0 == io_res.value() ? "closed by peer" : "readable");
+		return false;
+	}
+	const int err_num = io_res.error();
+	if (EAGAIN == err_num || EWOULDBLOCK == err_num)
+		return true;
+	DBG_PRINT(YEL "KdbConnPool" RST ": idle {} failed in recv: {}", conn, strerror(err_num));
+	return false;
+}
+
+//-------------------------------------------------------------------------------- KdbConnPool::Lease
+KdbConnPool::Lease::Lease(Lease && rhs) noexcept
+ : m_pool(std::exchange(rhs.m_pool, nullptr))
+ , m_target(rhs.m_target)
+ , m_conn(rhs.m_conn)
+ , m_discard(rhs.m_discard)
+{
+}
+
+KdbConnPool::Lease & KdbConnPool::Lease::operator=(Lease && rhs) noexcept
+{
+	if (this != &rhs) {
+		release();
+		m_pool = std::exchange(rhs.m_pool, nullptr);
+		m_target = rhs.m_target;
+		m_conn = rhs.m_conn;
+		m_discard = rhs.m_discard;
+	}
+	return *this;
+}
+
+void KdbConnPool::Lease::release() noexcept
+{
+	if (nullptr == m_pool)
+		return;
+	std::exchange(m_pool, nullptr)->put(*m_target, m_conn, m_discard);
+}
+
+//-------------------------------------------------------------------------------- KdbConnPool::Waiter
+void KdbConnPool::Waiter::await_suspend(std::coroutine_handle<> h) noexcept
+{
+	m_handle = h;
+	m_queued = true;
+	m_target.m_waiters.push_back(this);
+}
+
+KdbConnPool::Waiter::~Waiter()
+{
+	if (m_queued) {
+		auto it = std::find(m_target.m_waiters.begin(), m_target.m_waiters.end(), this);
+		if (m_target.m_waiters.end() != it)
+			m_target.m_waiters.erase(it);
+	}
+}
+
+//-------------------------------------------------------------------------------- KdbConnPool
+KdbConnPool::KdbConnPool(EpollCtl & epoll, AddrCache & cache, Limits limits)
+ : m_epoll(epoll)
+ , m_cache(cache)
+ , m_limits(limits)
+{
+}
+
+KdbConnPool::~KdbConnPool()
+{
+	m_closed = true;
+	for (std::unique_ptr<Target> & tgt : m_targets) {
+		for (Idle & idle : tgt->m_idle)
+			close(*tgt, idle.m_conn);
+		tgt->m_idle.clear();
+		// each finds the pool closed, and gives up
+		while (!tgt->m_waiters.empty())
+			wake(*tgt, io::TcpConn{});
+	}
+}
+
+KdbConnPool::Target & KdbConnPool::target(std::string_view host, std::string_view service, std::string_view user)
+{
+	for (std::unique_ptr<Target> & tgt : m_targets) {
+		if (host == tgt->m_host && service == tgt->m_service && user == tgt->m_user)
+			return *tgt;
+	}
+	m_targets.push_back(std::make_unique<Target>(Target{std::string{host}, std::string{service}, std::string{user}}));
+	return *m_targets.back();
+}
+
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> KdbConnPool::open(Target & tgt)
+{
+	// the slot is taken for the duration, lest concurrent callers exceed the limit
+	tgt.m_num_open += 1;
+
+	auto res_tc = co_await tcp_connect(m_epoll, m_cache, tgt.m_host, tgt.m_service);
+	if (!res_tc.has_value()) {
+		ERR_PRINT(YEL "KdbConnPool" RST ": failed to connect to {}:{}", tgt.m_host, tgt.m_service);
+		tgt.m_num_open -= 1;
+		wake(tgt, io::TcpConn{});
+		co_return std::unexpected(res_tc.error());
+	}
+
+	auto res_kc = co_await kdb_connect(m_epoll, res_tc.value(), tgt.m_user);
+	if (!res_kc.has_value()) {
+		ERR_PRINT(YEL "KdbConnPool" RST ": failed during handshake with {}:{}", tgt.m_host, tgt.m_service);
+		std::ignore = ::mg7x::io::close(res_tc.value().sock_fd());
+		tgt.m_num_open -= 1;
+		wake(tgt, io::TcpConn{});
+		co_return std::unexpected(res_kc.error());
+	}
+
+	m_num_opened += 1;
+	DBG_PRINT(YEL "KdbConnPool" RST ": opened {} as '{}'", res_tc.value(), tgt.m_user);
+	co_return res_tc.value();
+}
+
+void KdbConnPool::close(Target & tgt, io::TcpConn conn)
+{
+	DBG_PRINT(YEL "KdbConnPool" RST ": closing {}", conn);
+	std::ignore = ::mg7x::io::close(conn.sock_fd());
+	tgt.m_num_open -= 1;
+	m_num_discarded += 1;
+}
+
+void KdbConnPool::wake(Target & tgt, io::TcpConn conn)
+{
+	if (tgt.m_waiters.empty())
+		return;
+	Waiter *waiter = tgt.m_waiters.front();
+	tgt.m_waiters.pop_front();
+	waiter->m_queued = false;
+	waiter->m_conn = conn;
+	waiter->m_handle.resume();
+}
+
+void KdbConnPool::put(Target & tgt, io::TcpConn conn, bool discard)
+{
+	if (discard || m_closed) {
+		close(tgt, conn);
+		// there's now room for a waiter to open its own
+		wake(tgt, io::TcpConn{});
+	}
+	else if (!tgt.m_waiters.empty()) {
+		wake(tgt, conn);
+	}
+	else {
+		tgt.m_idle.push_back(Idle{conn, std::chrono::steady_clock::now()});
+	}
+}
+
+TASK_TYPE<std::expected<KdbConnPool::Lease,ErrnoMsg>> KdbConnPool::acquire(std::string_view host, std::string_view service, std::string_view user)
+{
+	Target & tgt = target(host, service, user);
+	while (true) {
+		if (m_closed)
+			co_return std::unexpected(ErrnoMsg{0, "Connection pool closed"});
+
+		// the most recently used is the least likely to have been timed out by the server
+		while (!tgt.m_idle.empty()) {
+			const io::TcpConn conn = tgt.m_idle.back().m_conn;
+			tgt.m_idle.pop_back();
+			if (idle_conn_healthy(conn)) {
+				m_num_reused += 1;
+				co_return Lease{*this, tgt, conn};
+			}
+			close(tgt, conn);
+		}
+
+		if (tgt.m_num_open < m_limits.m_max_per_target) {
+			auto res_op = co_await open(tgt);
+			if (!res_op.has_value())
+				co_return std::unexpected(res_op.error());
+			co_return Lease{*this, tgt, res_op.value()};
+		}
+
+		m_num_waits += 1;
+		Waiter waiter{tgt};
+		co_await waiter;
+		if (-1 != waiter.m_conn.sock_fd()) {
+			// handed over as released, so needs no checking
+			m_num_reused += 1;
+			co_return Lease{*this, tgt, waiter.m_conn};
+		}
+		// otherwise one was closed, making room to open another
+	}
+}
+
+TASK_TYPE<std::expected<size_t,ErrnoMsg>> KdbConnPool::warm(std::string_view host, std::string_view service, std::string_view user)
+{
+	Target & tgt = target(host, service, user);
+	size_t num = 0;
+	while (!m_closed && tgt.m_idle.size() < m_limits.m_min_idle && tgt.m_num_open < m_limits.m_max_per_target) {
+		auto res_op = co_await open(tgt);
+		if (!res_op.has_value()) {
+			if (0 == num)
+				co_return std::unexpected(res_op.error());
+			break;
+		}
+		// which may go straight to a waiter
+		put(tgt, res_op.value(), false);
+		num += 1;
+	}
+	co_return num;
+}
+
+size_t KdbConnPool::prune()
+{
+	const auto now = std::chrono::steady_clock::now();
+	size_t num = 0;
+	for (std::unique_ptr<Target> & tgt : m_targets) {
+		std::vector<Idle> keep{};
+		for (Idle & idle : tgt->m_idle) {
+			if (now - idle.m_since <= m_limits.m_max_idle && idle_conn_healthy(idle.m_conn)) {
+				keep.push_back(idle);
+			}
+			else {
+				close(*tgt, idle.m_conn);
+				num += 1;
+			}
+		}
+		// (no-one waits on a target with idle connections)
+		tgt->m_idle.swap(keep);
+	}
+	return num;
+}
+
+size_t KdbConnPool::numIdle() const noexcept
+{
+	size_t num = 0;
+	for (const std::unique_ptr<Target> & tgt : m_targets)
+		num += tgt->m_idle.size();
+	return num;
+}
+
+size_t KdbConnPool::numOpen() const noexcept
+{
+	size_t num = 0;
+	for (const std::unique_ptr<Target> & tgt : m_targets)
+		num += tgt->m_num_open;
+	return num;
+}
+
+}; // end namespace mg7x
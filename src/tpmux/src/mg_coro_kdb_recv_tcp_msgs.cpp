@@ -120,9 +120,9 @@ TASK_TYPE<std::expected<int,ErrnoMsg>> kdb_read_tcp_messages(EpollCtl & epoll, c
 				// table match: copy to output
 
 				// copy just the payload to the journal, without the 8-byte header:
-				io_res = ::mg7x::io::write(jnl.jnl_fd(), ary.data() + SZ_MSG_HDR + rd_off, len - SZ_MSG_HDR);
-				if (!io_res.has_value()) {
-					ERR_PRINT(GRN "kdb_read_tcp_messages" RST ": error writing to journal: %s", strerror(io_res.error()));
+				std::expected<uint64_t,std::string> ap_res = jnl.append(ary.data() + SZ_MSG_HDR + rd_off, len - SZ_MSG_HDR);
+				if (!ap_res.has_value()) {
+					ERR_PRINT(GRN "kdb_read_tcp_messages" RST ": error writing to journal: {}", ap_res.error());
 					handle_close(epoll, conn.sock_fd());
 				}
 				// TODO: forward the matching message to any connected subscribers
@@ -173,15 +173,14 @@ TASK_TYPE<std::expected<int,ErrnoMsg>> kdb_subscribe_and_replay(EpollCtl & epoll
 	}
 
 	KdbJournal src_jnl = jnl_res.value();
-	const int dst_fd = dst_jnl.jnl_fd();
 
 	std::string_view fn_name{"upd"};
 	const std::unordered_set<std::string_view> names{sub.tables().begin(), sub.tables().end()};
 
-	auto scribe = [&src_path, dst_fd](const int8_t *src, uint64_t len) -> int {
-		std::expected<ssize_t,int> res_zi = ::mg7x::io::write(dst_fd, src, len);
-		if (!res_zi) {
-			ERR_PRINT(CYN "kdb_subscribe_and_replay" RST ": failed while copying into local journal ({}): {}", src_path, strerror(res_zi.error()));
+	auto scribe = [&src_path, &dst_jnl](const int8_t *src, uint64_t len) -> int {
+		std::expected<uint64_t,std::string> res_ap = dst_jnl.append(src, len);
+		if (!res_ap) {
+			ERR_PRINT(CYN "kdb_subscribe_and_replay" RST ": failed while copying into local journal ({}): {}", src_path, res_ap.error());
 			return -1;
 		}
 		return 1;
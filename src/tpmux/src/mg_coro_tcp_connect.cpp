@@ -23,8 +23,11 @@
 #include <string.h>
 #include <errno.h>
 
+#include <algorithm> // std::min
 #include <expected>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "mg_coro_domain_obj.h"
 #include "mg_fmt_defs.h"
@@ -32,6 +35,7 @@
 #include "mg_io.h"
 #include "mg_coro_task.h"
 #include "mg_coro_epoll.h"
+#include "mg_coro_tcp_connect.h"
 
 
 static void mg_sigev_notify(union sigval arg) {
@@ -55,10 +59,11 @@ static void* get_in_addr(struct sockaddr *sa)
 	return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-static void mg_print_addrinfo(struct addrinfo *nfo)
+static void mg_print_addrinfo(const mg7x::ResolvedAddr & nfo)
 {
 	char buf[INET6_ADDRSTRLEN] = {0};
-	if (nullptr == inet_ntop(nfo->ai_family, get_in_addr(static_cast<struct sockaddr*>(nfo->ai_addr)), buf, sizeof buf)) {
+	struct sockaddr *sa = reinterpret_cast<struct sockaddr*>(const_cast<struct sockaddr_storage*>(&nfo.m_addr));
+	if (nullptr == inet_ntop(nfo.m_family, get_in_addr(sa), buf, sizeof buf)) {
 		ERR_PRINT("		in inet_ntop: {}", strerror(errno));
 	}
 	else {
@@ -77,9 +82,40 @@ static std::expected<int,int> create_event_fd()
 
 namespace mg7x {
 
-TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std::string_view host, std::string_view service)
+//-------------------------------------------------------------------------------- AddrCache
+std::string AddrCache::key(std::string_view host, std::string_view service)
+{
+	std::string k{host};
+	k.push_back(':');
+	k.append(service);
+	return k;
+}
+
+bool AddrCache::find(std::string_view host, std::string_view service, std::vector<ResolvedAddr> & addrs)
+{
+	auto it = m_entries.find(key(host, service));
+	if (m_entries.end() == it || it->second.m_expiry <= std::chrono::steady_clock::now()) {
+		m_num_misses += 1;
+		return false;
+	}
+	m_num_hits += 1;
+	addrs = it->second.m_addrs;
+	return true;
+}
+
+void AddrCache::store(std::string_view host, std::string_view service, const std::vector<ResolvedAddr> & addrs)
+{
+	m_entries.insert_or_assign(key(host, service), Entry{addrs, std::chrono::steady_clock::now() + m_ttl});
+}
+
+void AddrCache::evict(std::string_view host, std::string_view service)
+{
+	m_entries.erase(key(host, service));
+}
+
+//-------------------------------------------------------------------------------- tcp_connect
+static TASK_TYPE<std::expected<std::vector<ResolvedAddr>,ErrnoMsg>> resolve(EpollCtl & epoll, std::string_view host, std::string_view service)
 {
-	DBG_PRINT(GRN "tcp_connect" RST ": beginning tcp-connection to {}:{}", host, service);
 	std::expected<int,int> result = create_event_fd();
 	if (!result.has_value()) {
 		// already logged
@@ -90,9 +126,9 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 
 	DBG_PRINT(GRN "tcp_connect" RST ": created event_fd {}", event_fd);
 
-	struct addrinfo addrinfo;
-	struct gaicb gai_req;
-	struct sigevent sevp;
+	struct addrinfo addrinfo{};
+	struct gaicb gai_req{};
+	struct sigevent sevp{};
 	struct gaicb *gai_reqs[1];
 
 	gai_req.ar_name = host.data();
@@ -134,8 +170,6 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 		DBG_PRINT(GRN "tcp_connect" RST ": return from co_await EpollCtl::Awaiter, fd {}, events {}", fd, events);
 	}
 
-	struct addrinfo *res = gai_req.ar_result;
-
 	result = epoll.clr_interest(event_fd);
 	if (!result.has_value()) {
 		ERR_PRINT(GRN "tcp_connect" RST ": failed in EpollCtl::clr_interest");
@@ -148,12 +182,31 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 		WRN_PRINT(GRN "tcp_connect" RST ": incomplete close(eventfd) signalled: {}", strerror(result.error()));
 	}
 
-	for ( ; nullptr != res ; res = res->ai_next) {
+	std::vector<ResolvedAddr> addrs{};
+	for (struct addrinfo *res = gai_req.ar_result ; nullptr != res ; res = res->ai_next) {
+		ResolvedAddr addr{res->ai_family, res->ai_socktype, res->ai_protocol, res->ai_addrlen, {}};
+		memcpy(&addr.m_addr, res->ai_addr, std::min<size_t>(res->ai_addrlen, sizeof addr.m_addr));
+		addrs.push_back(addr);
+	}
+	if (nullptr != gai_req.ar_result)
+		freeaddrinfo(gai_req.ar_result);
+
+	if (addrs.empty()) {
+		WRN_PRINT(GRN "tcp_connect" RST ": no addresses found for {}:{}", host, service);
+		co_return std::unexpected(ErrnoMsg{0, "Could not resolve address"});
+	}
+	co_return addrs;
+}
+
+static TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> connect_any(EpollCtl & epoll, std::string_view host, std::string_view service, const std::vector<ResolvedAddr> & addrs)
+{
+	std::expected<int,int> result;
+	for (const ResolvedAddr & res : addrs) {
 		TRA_PRINT(GRN "tcp_connect" RST ": opening socket (port {})", service);
 		mg_print_addrinfo(res);
-		result = ::mg7x::io::socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, res->ai_protocol);
+		result = ::mg7x::io::socket(res.m_family, res.m_socktype | SOCK_NONBLOCK, res.m_protocol);
 		if (!result.has_value()) {
-			WRN_PRINT(GRN "tcp_connect" RST ": failed to create socket({}, {}, {}): {}", res->ai_family, res->ai_socktype, res->ai_protocol, strerror(result.error()));
+			WRN_PRINT(GRN "tcp_connect" RST ": failed to create socket({}, {}, {}): {}", res.m_family, res.m_socktype, res.m_protocol, strerror(result.error()));
 			continue;
 		}
 
@@ -161,7 +214,7 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 		TRA_PRINT(GRN "tcp_connect" RST ": created socket fd {}", sock_fd);
 
 		TRA_PRINT(GRN "tcp_connect" RST ": calling connect; fd {}, port {}", sock_fd, service);
-		result = ::mg7x::io::connect(sock_fd, res->ai_addr, res->ai_addrlen);
+		result = ::mg7x::io::connect(sock_fd, reinterpret_cast<const struct sockaddr*>(&res.m_addr), res.m_addrlen);
 		// EINPROGRESS for SOCK_STREAM, EAGAIN for UNIX domain sockets
 		if (!result.has_value() && EINPROGRESS != result.error() && EAGAIN != result.error()) {
 			ERR_PRINT(GRN "tcp_connect" RST ": failed in connect for FD {} to {}:{}: {}", sock_fd, host, service, strerror(result.error()));
@@ -171,10 +224,8 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 
 		if (result.has_value() && 0 == result.value()) { // already connected
 			INF_PRINT(GRN "tcp_connect" RST ": connected on FD {} to {}:{}", sock_fd, host, service);
-			freeaddrinfo(gai_req.ar_result);
 			co_return io::TcpConn{sock_fd, host, service};
 		}
-
 		{
 			EpollCtl::Awaiter awaiter{sock_fd};
 			result = epoll.add_interest(sock_fd, EPOLLOUT, awaiter);
@@ -228,4 +279,37 @@ TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std
 	WRN_PRINT(GRN "tcp_connect" RST ": connect failed; " RED "co_return" RST " -1");
 	co_return std::unexpected(ErrnoMsg{0, "Could not establish TCP connection"});
 }
+
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, std::string_view host, std::string_view service)
+{
+	DBG_PRINT(GRN "tcp_connect" RST ": beginning tcp-connection to {}:{}", host, service);
+
+	std::expected<std::vector<ResolvedAddr>,ErrnoMsg> addrs = co_await resolve(epoll, host, service);
+	if (!addrs.has_value())
+		co_return std::unexpected(addrs.error());
+
+	co_return co_await connect_any(epoll, host, service, addrs.value());
+}
+
+TASK_TYPE<std::expected<io::TcpConn,ErrnoMsg>> tcp_connect(EpollCtl & epoll, AddrCache & cache, std::string_view host, std::string_view service)
+{
+	DBG_PRINT(GRN "tcp_connect" RST ": beginning tcp-connection to {}:{} (cached lookup)", host, service);
+
+	std::vector<ResolvedAddr> cached{};
+	if (cache.find(host, service, cached)) {
+		std::expected<io::TcpConn,ErrnoMsg> conn = co_await connect_any(epoll, host, service, cached);
+		if (conn.has_value())
+			co_return conn;
+		// the process may have moved: look it up afresh
+		WRN_PRINT(GRN "tcp_connect" RST ": no cached address for {}:{} accepted a connection; resolving again", host, service);
+		cache.evict(host, service);
+	}
+
+	std::expected<std::vector<ResolvedAddr>,ErrnoMsg> addrs = co_await resolve(epoll, host, service);
+	if (!addrs.has_value())
+		co_return std::unexpected(addrs.error());
+	cache.store(host, service, addrs.value());
+
+	co_return co_await connect_any(epoll, host, service, addrs.value());
+}
 }; // end namespace mg7x
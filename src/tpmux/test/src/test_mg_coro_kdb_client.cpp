@@ -0,0 +1,276 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <print>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "MgKdbType.H"
+#include "mg_coro_kdb_client.h"
+
+namespace mg7x::test {
+
+static std::vector<int8_t> toIpc(KdbMsgType typ, const KdbBase & obj)
+{
+	KdbIpcMessageWriter writer{typ, obj};
+	std::vector<int8_t> ipc(writer.ipcLength());
+	EXPECT_EQ(WriteResult::WR_OK, writer.write(ipc.data(), ipc.size()));
+	return ipc;
+}
+
+// Stands in for a kdb+ process: answers each sync request with its own payload, in order,
+// after a delay standing in for the round-trip; requests read together are answered together
+static void echoServer(int fd, std::chrono::microseconds rtt, uint64_t max_replies)
+{
+	std::vector<int8_t> buf(64 * 1024);
+	size_t beg = 0, end = 0;
+	KdbIpcMessageReader rdr{};
+	ReadMsgResult res{};
+	uint64_t replies = 0;
+
+	const std::vector<int8_t> hello = toIpc(KdbMsgType::ASYNC, KdbSymbolAtom{"hello"});
+	if (static_cast<ssize_t>(hello.size()) != ::write(fd, hello.data(), hello.size()))
+		return;
+
+	while (replies < max_replies) {
+		const ssize_t got = ::read(fd, buf.data() + end, buf.size() - end);
+		if (got <= 0)
+			break;
+		end += got;
+
+		std::vector<int8_t> out{};
+		while (beg < end && replies < max_replies) {
+			const uint64_t used = rdr.getInputBytesConsumed();
+			const bool complete = rdr.readMsg(buf.data() + beg, end - beg, res);
+			beg += rdr.getInputBytesConsumed() - used;
+			if (!complete)
+				break;
+			rdr.reset();
+			const std::vector<int8_t> rsp = toIpc(KdbMsgType::RESPONSE, *res.message);
+			out.insert(out.end(), rsp.begin(), rsp.end());
+			replies += 1;
+		}
+		std::copy(buf.data() + beg, buf.data() + end, buf.data());
+		end -= beg;
+		beg = 0;
+
+		std::this_thread::sleep_for(rtt);
+		if (static_cast<ssize_t>(out.size()) != ::write(fd, out.data(), out.size()))
+			break;
+	}
+	::close(fd);
+}
+
+static int makeClientSocket(std::thread & server, std::chrono::microseconds rtt, uint64_t max_replies)
+{
+	int fds[2];
+	EXPECT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	EXPECT_EQ(0, ::fcntl(fds[0], F_SETFL, O_NONBLOCK));
+	server = std::thread{echoServer, fds[1], rtt, max_replies};
+	return fds[0];
+}
+
+// Issues `count` queries one after another, each awaiting the previous response
+static TASK_TYPE<int> querySequence(KdbClient & client, int64_t first, int64_t count)
+{
+	int ok = 0;
+	for (int64_t i = first ; i < first + count ; i++) {
+		KdbLongAtom qry{i};
+		KdbQueryResult res = co_await client.query(qry);
+		if (res.has_value() && KdbType::LONG_ATOM == res.value().message->m_typ
+		 && i == static_cast<KdbLongAtom*>(res.value().message.get())->m_val)
+			ok += 1;
+	}
+	co_return ok;
+}
+
+static TASK_TYPE<int> poolSequence(KdbClientPool & pool, int64_t first, int64_t count)
+{
+	int ok = 0;
+	for (int64_t i = first ; i < first + count ; i++) {
+		KdbLongAtom qry{i};
+		KdbQueryResult res = co_await pool.query(qry);
+		if (res.has_value() && i == static_cast<KdbLongAtom*>(res.value().message.get())->m_val)
+			ok += 1;
+	}
+	co_return ok;
+}
+
+static void runLoop(int epoll_fd, TaskContainer<int> & tasks)
+{
+	struct epoll_event events[16];
+	while (!tasks.complete()) {
+		const int nfds = ::epoll_wait(epoll_fd, events, 16, 1000);
+		ASSERT_GT(nfds, 0) << "timed out";
+		for (int i = 0 ; i < nfds ; i++)
+			(*static_cast<EpollFunc*>(events[i].data.ptr))(events[i].events);
+	}
+}
+
+TEST(MgCoroKdbClientTest, TestPipelinedQueries)
+{
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	std::thread server{};
+	KdbClient client{ctl, io::TcpConn{makeClientSocket(server, std::chrono::microseconds{0}, UINT64_MAX), "local", "echo"}};
+
+	ASSERT_TRUE(client.open().has_value());
+
+	{
+		// abandoned while outstanding: its response must not be handed to the next query
+		TASK_TYPE<int> gone = querySequence(client, -1, 1);
+		TaskContainer<int> abandoned{};
+		abandoned.add(gone);
+		EXPECT_EQ(1u, client.outstanding());
+	}
+
+	std::vector<TASK_TYPE<int>> seqs{};
+	for (int64_t i = 0 ; i < 16 ; i++)
+		seqs.push_back(querySequence(client, i * 1000, 50));
+	TaskContainer<int> tasks{};
+	for (TASK_TYPE<int> & seq : seqs)
+		tasks.add(seq);
+	runLoop(epoll_fd, tasks);
+
+	for (TASK_TYPE<int> & seq : seqs)
+		EXPECT_EQ(50, seq.value());
+	EXPECT_EQ(16u * 50 + 1, client.numSent());
+	EXPECT_EQ(16u * 50 + 1, client.numReceived());
+	EXPECT_EQ(0u, client.outstanding());
+	EXPECT_FALSE(client.failed());
+
+	::shutdown(client.conn().sock_fd(), SHUT_WR);
+	server.join();
+	::close(epoll_fd);
+}
+
+TEST(MgCoroKdbClientTest, TestFailureReachesEveryQuery)
+{
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	std::thread server{};
+	// the server answers three requests then hangs up
+	KdbClient client{ctl, io::TcpConn{makeClientSocket(server, std::chrono::microseconds{0}, 3), "local", "echo"}};
+	ASSERT_TRUE(client.open().has_value());
+
+	std::vector<TASK_TYPE<int>> seqs{};
+	for (int64_t i = 0 ; i < 4 ; i++)
+		seqs.push_back(querySequence(client, i * 1000, 10));
+	TaskContainer<int> tasks{};
+	for (TASK_TYPE<int> & seq : seqs)
+		tasks.add(seq);
+	runLoop(epoll_fd, tasks);
+
+	int ok = 0;
+	for (TASK_TYPE<int> & seq : seqs)
+		ok += seq.value();
+	EXPECT_EQ(3, ok);
+	EXPECT_TRUE(client.failed());
+	EXPECT_EQ(0u, client.outstanding());
+
+	// and later queries fail at once
+	TASK_TYPE<int> late = querySequence(client, 0, 1);
+	TaskContainer<int> more{};
+	more.add(late);
+	EXPECT_TRUE(more.complete());
+	EXPECT_EQ(0, late.value());
+
+	server.join();
+	::close(epoll_fd);
+}
+
+TEST(MgCoroKdbClientTest, TestPoolSpreadsLoad)
+{
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	std::thread servers[3];
+	KdbClientPool pool{};
+	for (std::thread & server : servers) {
+		pool.add(std::make_unique<KdbClient>(ctl, io::TcpConn{makeClientSocket(server, std::chrono::microseconds{50}, UINT64_MAX), "local", "echo"}));
+		ASSERT_TRUE(pool.at(pool.size() - 1).open().has_value());
+	}
+
+	std::vector<TASK_TYPE<int>> seqs{};
+	for (int64_t i = 0 ; i < 12 ; i++)
+		seqs.push_back(poolSequence(pool, i * 1000, 20));
+	TaskContainer<int> tasks{};
+	for (TASK_TYPE<int> & seq : seqs)
+		tasks.add(seq);
+	runLoop(epoll_fd, tasks);
+
+	for (TASK_TYPE<int> & seq : seqs)
+		EXPECT_EQ(20, seq.value());
+	uint64_t total = 0;
+	for (size_t i = 0 ; i < pool.size() ; i++) {
+		EXPECT_GT(pool.at(i).numReceived(), 12u * 20 / 6) << "replica " << i;
+		total += pool.at(i).numReceived();
+	}
+	EXPECT_EQ(12u * 20, total);
+
+	for (size_t i = 0 ; i < pool.size() ; i++)
+		::shutdown(pool.at(i).conn().sock_fd(), SHUT_WR);
+	for (std::thread & server : servers)
+		server.join();
+	::close(epoll_fd);
+}
+
+TEST(MgCoroKdbClientTest, DISABLED_TestBenchPipelineDepth)
+{
+	// with a fixed round-trip, throughput should grow with the number of requests in flight
+	constexpr int64_t TOTAL = 4096;
+	for (int64_t depth : {1, 8, 64}) {
+		const int epoll_fd = ::epoll_create1(0);
+		EpollCtl ctl{epoll_fd};
+		std::thread server{};
+		KdbClient client{ctl, io::TcpConn{makeClientSocket(server, std::chrono::microseconds{100}, UINT64_MAX), "local", "echo"}};
+		ASSERT_TRUE(client.open().has_value());
+
+		const auto beg = std::chrono::steady_clock::now();
+		std::vector<TASK_TYPE<int>> seqs{};
+		for (int64_t i = 0 ; i < depth ; i++)
+			seqs.push_back(querySequence(client, i * TOTAL, TOTAL / depth));
+		TaskContainer<int> tasks{};
+		for (TASK_TYPE<int> & seq : seqs)
+			tasks.add(seq);
+		runLoop(epoll_fd, tasks);
+		const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+
+		EXPECT_EQ(static_cast<uint64_t>(TOTAL), client.numReceived());
+		std::print("pipeline depth {:>2}: {} queries in {:.1f} ms, {:.0f} queries/s\n", depth, TOTAL, secs * 1e3, TOTAL / secs);
+
+		::shutdown(client.conn().sock_fd(), SHUT_WR);
+		server.join();
+		::close(epoll_fd);
+	}
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	// a server's hang-up should surface as EPIPE
+	::signal(SIGPIPE, SIG_IGN);
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,330 @@
+/* This file is part of the "Mg kdb+ Library" (hereinafter "The Library").
+ *
+ * The Library is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * The Library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE. See the GNU Affero Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero Public License along with The
+ * Library. If not, see https://www.gnu.org/licenses/agpl.txt.
+ */
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "mg_coro_kdb_conn_pool.h"
+
+namespace mg7x {
+extern
+TASK_TYPE<std::expected<KdbIpcLevel,ErrnoMsg>>
+	kdb_connect(EpollCtl & epoll, const io::TcpConn & conn, std::string_view user);
+}
+
+namespace mg7x::test {
+
+// Stands in for a kdb+ process: completes the handshake, then answers each 'p' with a 'p',
+// and hangs up on a 'q'
+class FakeKdbServer
+{
+	int m_listen_fd{-1};
+	std::string m_port{};
+	std::thread m_acceptor{};
+	std::mutex m_mutex{};
+	std::vector<std::thread> m_sessions{};
+	std::atomic<int> m_num_accepted{0};
+
+	static void session(int fd)
+	{
+		char buf[256];
+		bool logged_in = false;
+		while (true) {
+			const ssize_t got = ::read(fd, buf, sizeof buf);
+			if (got <= 0)
+				break;
+			ssize_t i = 0;
+			if (!logged_in) {
+				while (i < got && 0 != buf[i])
+					i++;
+				if (i == got)
+					continue;
+				i++;
+				logged_in = true;
+				const char ver = 3;
+				if (1 != ::write(fd, &ver, 1))
+					break;
+			}
+			for ( ; i < got ; i++) {
+				if ('q' == buf[i]) {
+					::close(fd);
+					return;
+				}
+				if (1 != ::write(fd, &buf[i], 1))
+					break;
+			}
+		}
+		::close(fd);
+	}
+
+public:
+	FakeKdbServer()
+	{
+		m_listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		EXPECT_EQ(0, ::bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr));
+		EXPECT_EQ(0, ::listen(m_listen_fd, 128));
+		socklen_t len = sizeof addr;
+		EXPECT_EQ(0, ::getsockname(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len));
+		m_port = std::to_string(ntohs(addr.sin_port));
+
+		m_acceptor = std::thread{[this] {
+			while (true) {
+				const int fd = ::accept(m_listen_fd, nullptr, nullptr);
+				if (-1 == fd)
+					break;
+				m_num_accepted += 1;
+				std::lock_guard<std::mutex> lock{m_mutex};
+				m_sessions.emplace_back(session, fd);
+			}
+		}};
+	}
+
+	~FakeKdbServer()
+	{
+		::shutdown(m_listen_fd, SHUT_RDWR);
+		m_acceptor.join();
+		::close(m_listen_fd);
+		for (std::thread & sess : m_sessions)
+			sess.join();
+	}
+
+	const std::string & port() const noexcept { return m_port; }
+	int numAccepted() const noexcept { return m_num_accepted; }
+};
+
+static void runLoop(int epoll_fd, TaskContainer<int> & tasks)
+{
+	struct epoll_event events[16];
+	while (!tasks.complete()) {
+		const int nfds = ::epoll_wait(epoll_fd, events, 16, 1000);
+		ASSERT_GT(nfds, 0) << "timed out";
+		for (int i = 0 ; i < nfds ; i++)
+			(*static_cast<EpollFunc*>(events[i].data.ptr))(events[i].events);
+	}
+}
+
+// a round-trip on a lent connection, which suspends the borrower meanwhile
+static TASK_TYPE<bool> ping(EpollCtl & epoll, const io::TcpConn & conn)
+{
+	char byte = 'p';
+	if (1 != ::write(conn.sock_fd(), &byte, 1))
+		co_return false;
+	{
+		EpollCtl::Awaiter awaiter{conn.sock_fd()};
+		if (!epoll.add_interest(conn.sock_fd(), EPOLLIN, awaiter).has_value())
+			co_return false;
+		co_await awaiter;
+		std::ignore = epoll.clr_interest(conn.sock_fd());
+	}
+	co_return 1 == ::read(conn.sock_fd(), &byte, 1) && 'p' == byte;
+}
+
+static TASK_TYPE<int> borrower(EpollCtl & epoll, KdbConnPool & pool, std::string_view port, int count)
+{
+	int ok = 0;
+	for (int i = 0 ; i < count ; i++) {
+		auto lease = co_await pool.acquire("127.0.0.1", port, "user");
+		if (!lease.has_value())
+			continue;
+		if (co_await ping(epoll, lease.value().conn()))
+			ok += 1;
+		else
+			lease.value().discard();
+	}
+	co_return ok;
+}
+
+TEST(MgCoroKdbConnPoolTest, TestReuseWithinLimit)
+{
+	FakeKdbServer server{};
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	AddrCache cache{};
+	{
+		KdbConnPool pool{ctl, cache, KdbConnPool::Limits{.m_max_per_target = 2, .m_min_idle = 1}};
+
+		std::vector<TASK_TYPE<int>> tasks{};
+		for (int i = 0 ; i < 6 ; i++)
+			tasks.push_back(borrower(ctl, pool, server.port(), 10));
+		TaskContainer<int> cont{};
+		for (TASK_TYPE<int> & task : tasks)
+			cont.add(task);
+		runLoop(epoll_fd, cont);
+
+		for (TASK_TYPE<int> & task : tasks)
+			EXPECT_EQ(10, task.value());
+		EXPECT_EQ(2u, pool.numOpened());
+		EXPECT_EQ(58u, pool.numReused());
+		EXPECT_GT(pool.numWaits(), 0u);
+		EXPECT_EQ(2u, pool.numOpen());
+		EXPECT_EQ(2u, pool.numIdle());
+		// the two connections were opened concurrently, so may both have missed the cache
+		EXPECT_EQ(2u, cache.numMisses() + cache.numHits());
+		EXPECT_EQ(1u, cache.size());
+	}
+	::close(epoll_fd);
+	EXPECT_EQ(2, server.numAccepted());
+}
+
+static TASK_TYPE<int> hangUpAndReacquire(EpollCtl & epoll, KdbConnPool & pool, std::string_view port)
+{
+	{
+		auto lease = co_await pool.acquire("127.0.0.1", port, "user");
+		if (!lease.has_value())
+			co_return 0;
+		// returned as healthy, though the server is about to hang up
+		const char byte = 'q';
+		if (1 != ::write(lease.value().conn().sock_fd(), &byte, 1))
+			co_return 0;
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds{20});
+
+	auto lease = co_await pool.acquire("127.0.0.1", port, "user");
+	if (!lease.has_value())
+		co_return 0;
+	co_return (co_await ping(epoll, lease.value().conn())) ? 1 : 0;
+}
+
+TEST(MgCoroKdbConnPoolTest, TestIdleHealthCheck)
+{
+	FakeKdbServer server{};
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	AddrCache cache{};
+	{
+		KdbConnPool pool{ctl, cache};
+
+		TASK_TYPE<int> task = hangUpAndReacquire(ctl, pool, server.port());
+		TaskContainer<int> cont{};
+		cont.add(task);
+		runLoop(epoll_fd, cont);
+
+		EXPECT_EQ(1, task.value());
+		EXPECT_EQ(2u, pool.numOpened());
+		EXPECT_EQ(1u, pool.numDiscarded());
+		EXPECT_EQ(1u, pool.numOpen());
+	}
+	::close(epoll_fd);
+}
+
+static TASK_TYPE<int> warmPool(KdbConnPool & pool, std::string_view port)
+{
+	auto num = co_await pool.warm("127.0.0.1", port, "user");
+	co_return num.has_value() ? static_cast<int>(num.value()) : -1;
+}
+
+TEST(MgCoroKdbConnPoolTest, TestWarmAndPrune)
+{
+	FakeKdbServer server{};
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	AddrCache cache{};
+	{
+		KdbConnPool pool{ctl, cache, KdbConnPool::Limits{.m_max_per_target = 4, .m_min_idle = 3, .m_max_idle = std::chrono::milliseconds{10}}};
+
+		TASK_TYPE<int> task = warmPool(pool, server.port());
+		TaskContainer<int> cont{};
+		cont.add(task);
+		runLoop(epoll_fd, cont);
+
+		EXPECT_EQ(3, task.value());
+		EXPECT_EQ(3u, pool.numIdle());
+		EXPECT_EQ(0u, pool.prune());
+		std::this_thread::sleep_for(std::chrono::milliseconds{20});
+		EXPECT_EQ(3u, pool.prune());
+		EXPECT_EQ(0u, pool.numOpen());
+	}
+	::close(epoll_fd);
+}
+
+// connects, logs in and pings, as a short-lived worker would without the pool
+static TASK_TYPE<int> connectEach(EpollCtl & epoll, std::string_view port, int count)
+{
+	int ok = 0;
+	for (int i = 0 ; i < count ; i++) {
+		auto conn = co_await tcp_connect(epoll, "localhost", port);
+		if (!conn.has_value())
+			continue;
+		auto lvl = co_await kdb_connect(epoll, conn.value(), "user");
+		if (lvl.has_value() && co_await ping(epoll, conn.value()))
+			ok += 1;
+		::close(conn.value().sock_fd());
+	}
+	co_return ok;
+}
+
+static TASK_TYPE<int> acquireEach(EpollCtl & epoll, KdbConnPool & pool, std::string_view port, int count)
+{
+	int ok = 0;
+	for (int i = 0 ; i < count ; i++) {
+		auto lease = co_await pool.acquire("localhost", port, "user");
+		if (lease.has_value() && co_await ping(epoll, lease.value().conn()))
+			ok += 1;
+	}
+	co_return ok;
+}
+
+TEST(MgCoroKdbConnPoolTest, DISABLED_TestBenchPooledRequests)
+{
+	constexpr int COUNT = 500;
+	FakeKdbServer server{};
+	const int epoll_fd = ::epoll_create1(0);
+	EpollCtl ctl{epoll_fd};
+	AddrCache cache{};
+	KdbConnPool pool{ctl, cache};
+
+	for (bool pooled : {false, true}) {
+		const auto beg = std::chrono::steady_clock::now();
+		TASK_TYPE<int> task = pooled ? acquireEach(ctl, pool, server.port(), COUNT) : connectEach(ctl, server.port(), COUNT);
+		TaskContainer<int> cont{};
+		cont.add(task);
+		runLoop(epoll_fd, cont);
+		const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+
+		EXPECT_EQ(COUNT, task.value());
+		std::print("{:>8}: {} requests in {:.1f} ms, {:.1f} us per request\n", pooled ? "pooled" : "unpooled", COUNT, secs * 1e3, secs * 1e6 / COUNT);
+	}
+	EXPECT_EQ(1u, pool.numOpened());
+	::close(epoll_fd);
+}
+
+}
+
+int main(int argc, char **argv)
+{
+	// a server's hang-up should surface as EPIPE
+	::signal(SIGPIPE, SIG_IGN);
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}